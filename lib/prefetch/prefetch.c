@@ -0,0 +1,305 @@
+// Background image loader for the labeler.
+//
+// The ring has one slot per image in the window around the current image,
+// image i lives in slot i % nslots. The window moves with every
+// prefetch_get(), slots that fall out of it are freed by the loader before
+// it decodes the next wanted image: the current one first, then the next
+// images ahead, then the ones behind.
+//
+// cc -std=c11 -O2 -c prefetch.c -lpthread
+#define _POSIX_C_SOURCE 200809L
+#include "prefetch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// from wuffs (WUFFS_CONFIG__ENABLE_DROP_IN_REPLACEMENT__STB)
+unsigned char *stbi_load_from_memory(const unsigned char *buffer, int len,
+	int *x, int *y, int *channels_in_file, int desired_channels);
+void stbi_image_free(void *pixels);
+
+enum { EMPTY, READY, FAILED, OVER_BUDGET };
+
+typedef struct {
+	int index; // -1 if unused
+	int state;
+	uint8_t *pixels;
+	int width, height;
+	size_t bytes;
+} slot;
+
+struct prefetch {
+	char **paths;
+	int n;
+	size_t budget, used, largest;
+	int ahead, behind;
+	int current, direction;
+
+	slot *slots;
+	int nslots;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t wake; // loader waits for a new request
+	pthread_cond_t done; // prefetch_get() waits for an image
+	pthread_t thread;
+	int stop;
+};
+
+static int in_window(const prefetch *p, int index)
+{
+	const int ahead = p->direction > 0 ? p->ahead : p->behind;
+	const int behind = p->direction > 0 ? p->behind : p->ahead;
+	return index >= p->current - behind && index <= p->current + ahead;
+}
+
+static void clear_slot(prefetch *p, slot *s)
+{
+	if (s->pixels) {
+		stbi_image_free(s->pixels);
+		p->used -= s->bytes;
+	}
+	*s = (slot){.index = -1, .state = EMPTY};
+}
+
+static int wanted(const prefetch *p, int index)
+{
+	if (index < 0 || index >= p->n) {
+		return 0;
+	}
+	const slot *s = &p->slots[index % p->nslots];
+	if (s->index != index || s->state == EMPTY) {
+		return 1;
+	}
+	return s->state == OVER_BUDGET && index == p->current;
+}
+
+// Next image to decode, or -1. Called with the mutex held.
+static int next_wanted(const prefetch *p)
+{
+	if (wanted(p, p->current)) {
+		return p->current;
+	}
+
+	// Only start on a neighbour if an image as large as the largest so
+	// far still fits.
+	if (p->used + p->largest > p->budget) {
+		return -1;
+	}
+	const int dir = p->direction > 0 ? 1 : -1;
+	for (int d = 1; d <= p->ahead; d++) {
+		const int i = p->current + dir * d;
+		if (wanted(p, i) && p->slots[i % p->nslots].state != OVER_BUDGET) {
+			return i;
+		}
+	}
+	for (int d = 1; d <= p->behind; d++) {
+		const int i = p->current - dir * d;
+		if (wanted(p, i) && p->slots[i % p->nslots].state != OVER_BUDGET) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static uint8_t *decode(const char *path, int *width, int *height)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	uint8_t *buf = NULL;
+	size_t len = 0, cap = 0;
+	for (;;) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 1 << 20;
+			uint8_t *grown = realloc(buf, cap);
+			if (!grown) {
+				free(buf);
+				fclose(f);
+				return NULL;
+			}
+			buf = grown;
+		}
+		const size_t got = fread(buf + len, 1, cap - len, f);
+		if (got == 0) {
+			break;
+		}
+		len += got;
+	}
+	fclose(f);
+
+	int channels;
+	uint8_t *pixels = NULL;
+	if (len > 0 && len <= 0x7fffffff) {
+		pixels = stbi_load_from_memory(buf, (int)len, width, height,
+			&channels, 4);
+	}
+	free(buf);
+	return pixels;
+}
+
+static void *loader(void *arg)
+{
+	prefetch *p = arg;
+
+	pthread_mutex_lock(&p->mutex);
+	while (!p->stop) {
+		for (int i = 0; i < p->nslots; i++) {
+			slot *s = &p->slots[i];
+			if (s->index >= 0 && !in_window(p, s->index)) {
+				clear_slot(p, s);
+			}
+		}
+
+		const int index = next_wanted(p);
+		if (index < 0) {
+			pthread_cond_wait(&p->wake, &p->mutex);
+			continue;
+		}
+
+		slot *s = &p->slots[index % p->nslots];
+		clear_slot(p, s);
+		s->index = index;
+
+		pthread_mutex_unlock(&p->mutex);
+		int width = 0, height = 0;
+		uint8_t *pixels = decode(p->paths[index], &width, &height);
+		pthread_mutex_lock(&p->mutex);
+
+		const size_t bytes = (size_t)width * height * 4;
+		if (p->stop || s->index != index || !in_window(p, index)) {
+			stbi_image_free(pixels);
+			if (s->index == index) {
+				clear_slot(p, s);
+			}
+		} else if (!pixels) {
+			s->state = FAILED;
+		} else if (index != p->current && p->used + bytes > p->budget) {
+			stbi_image_free(pixels);
+			s->state = OVER_BUDGET;
+		} else {
+			s->state = READY;
+			s->pixels = pixels;
+			s->width = width;
+			s->height = height;
+			s->bytes = bytes;
+			p->used += bytes;
+		}
+		if (bytes > p->largest) {
+			p->largest = bytes;
+		}
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+prefetch *prefetch_new(const char *const *paths, int n, size_t budget,
+	int ahead, int behind)
+{
+	prefetch *p = calloc(1, sizeof(prefetch));
+	if (!p) {
+		return NULL;
+	}
+	p->n = n;
+	p->budget = budget;
+	p->ahead = ahead > 0 ? ahead : 0;
+	p->behind = behind > 0 ? behind : 0;
+	p->direction = 1;
+	p->current = -1 - p->ahead - p->behind; // nothing wanted yet
+	p->nslots = p->ahead + p->behind + 1;
+	p->paths = calloc(n > 0 ? n : 1, sizeof(char *));
+	p->slots = calloc(p->nslots, sizeof(slot));
+	if (!p->paths || !p->slots) {
+		goto fail;
+	}
+	for (int i = 0; i < n; i++) {
+		p->paths[i] = strdup(paths[i]);
+		if (!p->paths[i]) {
+			goto fail;
+		}
+	}
+	for (int i = 0; i < p->nslots; i++) {
+		p->slots[i].index = -1;
+	}
+
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->done, NULL);
+	if (pthread_create(&p->thread, NULL, loader, p) != 0) {
+		pthread_mutex_destroy(&p->mutex);
+		pthread_cond_destroy(&p->wake);
+		pthread_cond_destroy(&p->done);
+		goto fail;
+	}
+	return p;
+
+fail:
+	if (p->paths) {
+		for (int i = 0; i < n; i++) {
+			free(p->paths[i]);
+		}
+	}
+	free(p->paths);
+	free(p->slots);
+	free(p);
+	return NULL;
+}
+
+const uint8_t *prefetch_get(prefetch *p, int index, int direction,
+	int *width, int *height)
+{
+	if (index < 0 || index >= p->n) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&p->mutex);
+	p->current = index;
+	p->direction = direction < 0 ? -1 : 1;
+	for (int i = 0; i < p->nslots; i++) {
+		// memory may have been freed, try again
+		if (p->slots[i].state == OVER_BUDGET) {
+			p->slots[i].state = EMPTY;
+		}
+	}
+	pthread_cond_signal(&p->wake);
+
+	slot *s = &p->slots[index % p->nslots];
+	while (s->index != index || (s->state != READY && s->state != FAILED)) {
+		pthread_cond_wait(&p->done, &p->mutex);
+	}
+	const uint8_t *pixels = s->pixels;
+	*width = s->width;
+	*height = s->height;
+	pthread_mutex_unlock(&p->mutex);
+	return pixels;
+}
+
+void prefetch_free(prefetch *p)
+{
+	if (!p) {
+		return;
+	}
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->thread, NULL);
+
+	for (int i = 0; i < p->nslots; i++) {
+		clear_slot(p, &p->slots[i]);
+	}
+	for (int i = 0; i < p->n; i++) {
+		free(p->paths[i]);
+	}
+	free(p->paths);
+	free(p->slots);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->wake);
+	pthread_cond_destroy(&p->done);
+	free(p);
+}
@@ -0,0 +1,26 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes images on a background thread, keeping a ring of the images
+// around the one shown: `ahead` images in the direction of navigation and
+// `behind` images in the other, within `budget` bytes of decoded pixels.
+// Images are decoded to RGBA with stbi_load_from_memory.
+typedef struct prefetch prefetch;
+
+// `paths` are copied. Returns NULL if the thread cannot be started.
+prefetch *prefetch_new(const char *const *paths, int n, size_t budget,
+	int ahead, int behind);
+
+// Show image `index`, moving in `direction` (+1 or -1). Waits until the
+// image is decoded and returns its pixels, or NULL if it could not be
+// loaded. The pixels stay valid until the next call.
+const uint8_t *prefetch_get(prefetch *p, int index, int direction,
+	int *width, int *height);
+
+// Stop the thread and free all images.
+void prefetch_free(prefetch *p);
+
+#endif
@@ -0,0 +1,339 @@
+// Separable RGBA resampler for the display path of the labeler.
+//
+// Each output pixel is a weighted sum of `taps` neighbouring source pixels,
+// first along the row (into 16 bit intermediate rows), then along the
+// column. Weights are 14 bit fixed point and sum to exactly 1.0, so the
+// SSE and the plain C paths give identical results.
+//
+// cc -std=c11 -O2 -msse4.2 -c rescale.c -lpthread
+#define _POSIX_C_SOURCE 200809L
+#include "rescale.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#define RESCALE_SSE 1
+#endif
+
+#define WEIGHT_BITS 14
+#define HROW_SHIFT 7 // 255 << 14 >> 7 still fits in an int16
+#define MAX_THREADS 64
+#define MIN_ROWS_PER_THREAD 32
+
+typedef struct {
+	int taps;         // weights per output pixel
+	int *start;       // first source pixel of each output pixel
+	int16_t *weights; // `taps` weights per output pixel
+} filter;
+
+typedef struct {
+	const filter *hf, *vf;
+	const uint8_t *src;
+	int src_stride;
+	uint8_t *dst;
+	int dst_w, dst_h, dst_stride;
+	int flip;
+	int y0, y1; // output rows of this job
+	int result;
+	pthread_t thread;
+} job;
+
+static void free_filter(filter *f)
+{
+	free(f->start);
+	free(f->weights);
+}
+
+// Area filter for shrinking, bilinear interpolation for enlarging.
+// Windows at the image border are moved inwards, so that every tap reads
+// a valid source pixel.
+static int make_filter(filter *f, int src, int dst)
+{
+	const double scale = (double)src / dst;
+	int taps = scale > 1.0 ? (int)ceil(scale) + 2 : 2;
+	taps += taps & 1; // SSE processes pairs of taps
+	if (taps > src) {
+		taps = src;
+	}
+
+	f->taps = taps;
+	f->start = malloc(sizeof(int) * dst);
+	f->weights = calloc((size_t)dst * taps, sizeof(int16_t));
+	double *w = malloc(sizeof(double) * taps);
+	if (!f->start || !f->weights || !w) {
+		free(w);
+		free_filter(f);
+		return -1;
+	}
+
+	for (int o = 0; o < dst; o++) {
+		int first, last;
+		memset(w, 0, sizeof(double) * taps);
+
+		if (scale > 1.0) {
+			const double lo = o * scale;
+			const double hi = fmin((o + 1) * scale, src);
+			first = (int)lo;
+			last = (int)ceil(hi);
+			if (last > src) {
+				last = src;
+			}
+			if (last - first > taps) {
+				last = first + taps;
+			}
+
+			int start = first < src - taps ? first : src - taps;
+			for (int i = first; i < last; i++) {
+				const double overlap = fmin(i + 1, hi) - fmax(i, lo);
+				w[i - start] = overlap > 0 ? overlap / scale : 0;
+			}
+			f->start[o] = start;
+		} else {
+			double c = (o + 0.5) * scale - 0.5;
+			if (c < 0) {
+				c = 0;
+			}
+			if (c > src - 1) {
+				c = src - 1;
+			}
+			first = (int)c;
+			const double frac = c - first;
+
+			int start = first < src - taps ? first : src - taps;
+			w[first - start] += 1.0 - frac;
+			if (frac > 0) {
+				w[first + 1 - start] += frac;
+			}
+			f->start[o] = start;
+		}
+
+		// Round to fixed point and give the rounding error to the
+		// largest weight, so that flat areas keep their value.
+		int16_t *iw = &f->weights[(size_t)o * taps];
+		int sum = 0;
+		int largest = 0;
+		for (int k = 0; k < taps; k++) {
+			iw[k] = (int16_t)lround(w[k] * (1 << WEIGHT_BITS));
+			sum += iw[k];
+			if (iw[k] > iw[largest]) {
+				largest = k;
+			}
+		}
+		iw[largest] += (1 << WEIGHT_BITS) - sum;
+	}
+
+	free(w);
+	return 0;
+}
+
+// Filter one source row horizontally into `out` (4 int16 per pixel).
+static void filter_row(const filter *f, const uint8_t *row, int16_t *out,
+	int dst_w)
+{
+	const int taps = f->taps;
+	const int round = 1 << (HROW_SHIFT - 1);
+
+	for (int x = 0; x < dst_w; x++) {
+		const uint8_t *p = row + (size_t)f->start[x] * 4;
+		const int16_t *w = &f->weights[(size_t)x * taps];
+		int k = 0;
+
+#if RESCALE_SSE
+		// [r0 g0 b0 a0 r1 g1 b1 a1] -> [r0 r1 g0 g1 b0 b1 a0 a1]
+		const __m128i pairs = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11,
+			4, 5, 12, 13, 6, 7, 14, 15);
+		__m128i acc = _mm_set1_epi32(round);
+		for (; k + 1 < taps; k += 2) {
+			__m128i px = _mm_loadl_epi64((const __m128i *)(p + k * 4));
+			px = _mm_shuffle_epi8(_mm_cvtepu8_epi16(px), pairs);
+			const __m128i wk = _mm_set1_epi32(
+				(uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(px, wk));
+		}
+		if (k < taps) {
+			int32_t last;
+			memcpy(&last, p + k * 4, 4);
+			const __m128i px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(last));
+			acc = _mm_add_epi32(acc,
+				_mm_madd_epi16(px, _mm_set1_epi32((uint16_t)w[k])));
+		}
+		acc = _mm_srai_epi32(acc, HROW_SHIFT);
+		_mm_storel_epi64((__m128i *)(out + (size_t)x * 4),
+			_mm_packs_epi32(acc, acc));
+#else
+		int acc[4] = {round, round, round, round};
+		for (; k < taps; k++) {
+			for (int c = 0; c < 4; c++) {
+				acc[c] += w[k] * p[k * 4 + c];
+			}
+		}
+		for (int c = 0; c < 4; c++) {
+			out[(size_t)x * 4 + c] = (int16_t)(acc[c] >> HROW_SHIFT);
+		}
+#endif
+	}
+}
+
+// Combine `taps` horizontally filtered rows into one output row.
+static void filter_column(const int16_t *const *rows, const int16_t *w,
+	int taps, uint8_t *out, int n)
+{
+	const int shift = WEIGHT_BITS + HROW_SHIFT;
+	const int round = 1 << (shift - 1);
+	int i = 0;
+
+#if RESCALE_SSE
+	for (; i + 8 <= n; i += 8) {
+		__m128i lo = _mm_set1_epi32(round);
+		__m128i hi = lo;
+		int k = 0;
+		for (; k < taps; k += 2) {
+			const __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+			__m128i b = _mm_setzero_si128();
+			int16_t wb = 0;
+			if (k + 1 < taps) {
+				b = _mm_loadu_si128((const __m128i *)(rows[k + 1] + i));
+				wb = w[k + 1];
+			}
+			const __m128i wk = _mm_set1_epi32(
+				(uint16_t)w[k] | ((uint32_t)(uint16_t)wb << 16));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wk));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wk));
+		}
+		lo = _mm_srai_epi32(lo, shift);
+		hi = _mm_srai_epi32(hi, shift);
+		const __m128i px = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(px, px));
+	}
+#endif
+
+	for (; i < n; i++) {
+		int acc = round;
+		for (int k = 0; k < taps; k++) {
+			acc += w[k] * rows[k][i];
+		}
+		acc >>= shift;
+		out[i] = (uint8_t)(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+	}
+}
+
+// Produce output rows [y0, y1). Horizontally filtered source rows are kept
+// in a ring, since neighbouring output rows share most of their sources.
+static void *run_job(void *arg)
+{
+	job *j = arg;
+	const int taps = j->vf->taps;
+	const size_t rowlen = (size_t)j->dst_w * 4;
+
+	int16_t *ring = malloc(sizeof(int16_t) * rowlen * taps);
+	int *tag = malloc(sizeof(int) * taps);
+	const int16_t **rows = malloc(sizeof(int16_t *) * taps);
+	if (!ring || !tag || !rows) {
+		free(ring);
+		free(tag);
+		free(rows);
+		j->result = -1;
+		return NULL;
+	}
+	for (int k = 0; k < taps; k++) {
+		tag[k] = -1;
+	}
+
+	for (int y = j->y0; y < j->y1; y++) {
+		const int start = j->vf->start[y];
+		for (int k = 0; k < taps; k++) {
+			const int sy = start + k;
+			const int slot = sy % taps;
+			int16_t *hrow = ring + rowlen * slot;
+			if (tag[slot] != sy) {
+				filter_row(j->hf, j->src + (size_t)sy * j->src_stride,
+					hrow, j->dst_w);
+				tag[slot] = sy;
+			}
+			rows[k] = hrow;
+		}
+
+		const int dy = j->flip ? j->dst_h - 1 - y : y;
+		filter_column(rows, &j->vf->weights[(size_t)y * taps], taps,
+			j->dst + (size_t)dy * j->dst_stride, (int)rowlen);
+	}
+
+	free(ring);
+	free(tag);
+	free(rows);
+	j->result = 0;
+	return NULL;
+}
+
+int rescale_rgba(const uint8_t *src, int src_w, int src_h, int src_stride,
+	uint8_t *dst, int dst_w, int dst_h, int dst_stride,
+	int flip, int threads)
+{
+	if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+		return -1;
+	}
+
+	filter hf, vf;
+	if (make_filter(&hf, src_w, dst_w) != 0) {
+		return -1;
+	}
+	if (make_filter(&vf, src_h, dst_h) != 0) {
+		free_filter(&hf);
+		return -1;
+	}
+
+	if (threads <= 0) {
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (threads > dst_h / MIN_ROWS_PER_THREAD) {
+		threads = dst_h / MIN_ROWS_PER_THREAD;
+	}
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+
+	// The calling thread runs the first band itself.
+	job jobs[MAX_THREADS];
+	for (int t = 0; t < threads; t++) {
+		jobs[t] = (job){
+			.hf = &hf, .vf = &vf,
+			.src = src, .src_stride = src_stride,
+			.dst = dst, .dst_w = dst_w, .dst_h = dst_h,
+			.dst_stride = dst_stride, .flip = flip,
+			.y0 = (int)((int64_t)dst_h * t / threads),
+			.y1 = (int)((int64_t)dst_h * (t + 1) / threads),
+		};
+	}
+
+	int started[MAX_THREADS] = {0};
+	for (int t = 1; t < threads; t++) {
+		started[t] = pthread_create(&jobs[t].thread, NULL, run_job,
+			&jobs[t]) == 0;
+		if (!started[t]) {
+			run_job(&jobs[t]);
+		}
+	}
+	run_job(&jobs[0]);
+
+	int result = jobs[0].result;
+	for (int t = 1; t < threads; t++) {
+		if (started[t]) {
+			pthread_join(jobs[t].thread, NULL);
+		}
+		if (jobs[t].result != 0) {
+			result = -1;
+		}
+	}
+
+	free_filter(&hf);
+	free_filter(&vf);
+	return result;
+}
@@ -0,0 +1,17 @@
+#ifndef RESCALE_H
+#define RESCALE_H
+
+#include <stdint.h>
+
+// Resample an RGBA image (4 bytes per pixel) to dst_w x dst_h.
+// Shrinking averages the source area under each output pixel,
+// enlarging interpolates bilinearly.
+// `flip` writes the rows of dst bottom-up (OpenGL texture order).
+// `threads` limits the number of threads, 0 uses every core.
+// Strides are in bytes. Returns 0 on success, -1 on invalid sizes or
+// allocation failure.
+int rescale_rgba(const uint8_t *src, int src_w, int src_h, int src_stride,
+	uint8_t *dst, int dst_w, int dst_h, int dst_stride,
+	int flip, int threads);
+
+#endif